@@ -3,7 +3,7 @@
   Portal Wi-Fi+MQTT (sólo primera vez) + Reset por botón (10s) + Detector Apple 0x004C + MQTT + NVS
   - AP WPA2 con IP 192.168.1.1 para configurar SSID/Pass Wi-Fi y MQTT (host/puerto/usuario/clave)
   - Arranques normales: conecta a Wi-Fi guardada y usa MQTT guardado (no vuelve al portal automáticamente)
-  - Reset de fábrica manteniendo botón (GPIO0/BOOT) 10 s: borra NVS (wifi+cfg+mqtt) y reinicia al portal
+  - Reset de fábrica manteniendo botón (GPIO0/BOOT) 10 s: borra NVS (wifi+cfg+mqtt+shadow) y reinicia al portal
   - FIX: NO se inicia BLE en modo portal para evitar conflictos con SoftAP/DHCP
 */
 
@@ -21,7 +21,7 @@ unsigned long pressStart = 0;
 bool buttonWasPressed = false;
 
 // =================== AP (PORTAL PRIMERA VEZ) =================
-Preferences prefs;              // compartido (wifi, mqtt, cfg)
+Preferences prefs;              // compartido (wifi, mqtt, cfg, shadow)
 WebServer server(80);
 DNSServer dns;
 const byte DNS_PORT = 53;
@@ -172,6 +172,7 @@ void startAP() {
     prefs.begin("wifi", false); prefs.clear(); prefs.end();
     prefs.begin("cfg",  false); prefs.clear(); prefs.end();
     prefs.begin("mqtt", false); prefs.clear(); prefs.end();
+    prefs.begin("shadow", false); prefs.clear(); prefs.end();
     WiFi.disconnect(true, true);
     server.send(200, "text/html", htmlPage("<h2>Reset de fábrica</h2><p>Reiniciando…</p>"));
     delay(1200);
@@ -224,6 +225,10 @@ String st_window          = paramsBase + "/strong_window_ms/state";
 String st_vstrongAge      = paramsBase + "/vstrong_age_ms/state";
 String st_offgap          = paramsBase + "/off_gap_ms/state";
 
+// Shadows: home/<id>/shadow/<n>/set (cmd), /config (estado), /stats (comparativa)
+String shadowBase = String("home/") + DEVICE_ID + "/shadow";
+String cmd_shadow = shadowBase + "/+/set";
+
 // Parámetros por defecto (modo reposo)
 int      RSSI_VERY_STRONG        = -52;
 int      RSSI_STRONG             = -56;
@@ -242,43 +247,66 @@ struct Hit { uint32_t ts; int rssi; };
 Hit hits[MAX_HITS];
 uint8_t hitCount = 0;
 
+// Envolvente del buffer compartido con los shadows (ver recomputeHitEnvelope)
+int      hitAdmitRssi = RSSI_STRONG;       // RSSI mínimo para guardar un hit
+uint32_t hitRetainMs  = STRONG_WINDOW_MS;  // antigüedad máxima en hits[]
+volatile uint32_t weakHitsLost = 0;        // hits sólo-shadow perdidos por buffer lleno
+
 inline uint32_t nowMs() { return millis(); }
 
 void addHit(int rssi) {
   const uint32_t t = nowMs();
   if (hitCount < MAX_HITS) { hits[hitCount++] = {t, rssi}; return; }
-  for (uint8_t i = 0; i < MAX_HITS - 1; i++) hits[i] = hits[i + 1];
+  // Lleno: se sacrifica el hit sólo-shadow más antiguo; si no hay ninguno, un hit
+  // débil nuevo se descarta (nunca desplaza a los de producción)
+  int drop = -1;
+  for (uint8_t i = 0; i < MAX_HITS; i++)
+    if (hits[i].rssi < RSSI_STRONG) { drop = i; break; }
+  if (drop >= 0 || rssi < RSSI_STRONG) weakHitsLost++;
+  if (drop < 0) {
+    if (rssi < RSSI_STRONG) return;
+    drop = 0;
+  }
+  for (uint8_t i = (uint8_t)drop; i < MAX_HITS - 1; i++) hits[i] = hits[i + 1];
   hits[MAX_HITS - 1] = {t, rssi};
 }
 
+// Por antigüedad y no por "ts >= now - window": no borra todo mientras
+// millis() < windowMs (arranque y desbordamiento de millis()).
 void pruneOld(uint32_t windowMs) {
-  const uint32_t cutoff = nowMs() - windowMs;
+  const uint32_t t = nowMs();
   uint8_t w = 0;
   for (uint8_t i = 0; i < hitCount; i++)
-    if (hits[i].ts >= cutoff) hits[w++] = hits[i];
+    if ((int32_t)(t - hits[i].ts) <= (int32_t)windowMs) hits[w++] = hits[i];
   hitCount = w;
 }
 
+// hits[] puede retener hits más débiles/antiguos para los shadows: producción
+// filtra siempre por RSSI_STRONG y STRONG_WINDOW_MS para no cambiar su lógica.
 uint8_t countStrongInWindow() {
-  pruneOld(STRONG_WINDOW_MS);
+  pruneOld(hitRetainMs);
+  const uint32_t cutoff = nowMs() - STRONG_WINDOW_MS;
   uint8_t c = 0;
   for (uint8_t i = 0; i < hitCount; i++)
-    if (hits[i].rssi >= RSSI_STRONG) c++;
+    if (hits[i].rssi >= RSSI_STRONG && hits[i].ts >= cutoff) c++;
   return c;
 }
 
 bool haveVeryStrongRecent() {
+  const uint32_t cutWin = nowMs() - STRONG_WINDOW_MS;
   const uint32_t cutoff = nowMs() - VERY_STRONG_MAX_AGE_MS;
   for (uint8_t i = 0; i < hitCount; i++)
-    if (hits[i].rssi >= RSSI_VERY_STRONG && hits[i].ts >= cutoff) return true;
+    if (hits[i].rssi >= RSSI_STRONG && hits[i].rssi >= RSSI_VERY_STRONG
+        && hits[i].ts >= cutoff && hits[i].ts >= cutWin) return true;
   return false;
 }
 
 uint32_t ageSinceLastStrong() {
+  const uint32_t cutWin = nowMs() - STRONG_WINDOW_MS;
   int best = -200;
   uint32_t tsBest = 0;
   for (uint8_t i = 0; i < hitCount; i++) {
-    if (hits[i].rssi >= RSSI_STRONG && hits[i].rssi > best) {
+    if (hits[i].rssi >= RSSI_STRONG && hits[i].ts >= cutWin && hits[i].rssi > best) {
       best = hits[i].rssi; tsBest = hits[i].ts;
     }
   }
@@ -288,6 +316,165 @@ uint32_t ageSinceLastStrong() {
 volatile int lastStrongRSSI_forAttr = -127;
 bool present = false;
 bool firstScanDone = false;
+uint32_t prodOnTs = 0, prodOffTs = 0;   // último flanco ON/OFF de producción
+
+// ============== Shadows: configuraciones alternativas ===========
+// Evalúan en paralelo el mismo flujo de hits que la lógica de loop() con otros
+// parámetros. No publican estado de presencia, sólo estadísticas comparativas
+// frente a producción. Comparten hits[]: por shadow sólo hay parámetros y
+// contadores (96 bytes), y todos se evalúan en una única pasada del buffer.
+#define MAX_SHADOWS 8
+
+struct DetParams {
+  int      rssiStrong;
+  int      rssiVeryStrong;
+  uint8_t  hitsReq;
+  uint32_t windowMs;
+  uint32_t vstrongAgeMs;   // 0 = entrada sólo por número de hits
+  uint32_t offGapMs;
+};
+
+struct Shadow {
+  int64_t   onLatSumMs, offLatSumMs;   // >0: el shadow llega más tarde que producción
+  DetParams p;
+  uint32_t  lastOnTs, lastOffTs;
+  uint32_t  onLatN, offLatN;
+  uint32_t  missedOn, missedOff;       // flancos de producción sin flanco del shadow
+  uint32_t  flaps, prodFlaps;
+  uint32_t  disagreeMs, evalMs;
+  uint32_t  weakLostBase;              // weakHitsLost al resetear
+  bool      active;
+  bool      present;
+  bool      onMatched, offMatched;     // flanco de producción ya emparejado
+  bool      onFresh, offFresh;         // flanco del shadow posterior al opuesto de producción
+};
+Shadow shadows[MAX_SHADOWS];
+
+// El buffer debe admitir y retener lo que necesite cualquiera de las configuraciones
+void recomputeHitEnvelope() {
+  int admit = RSSI_STRONG;
+  uint32_t retain = STRONG_WINDOW_MS;
+  for (uint8_t k = 0; k < MAX_SHADOWS; k++) {
+    if (!shadows[k].active) continue;
+    if (shadows[k].p.rssiStrong < admit) admit = shadows[k].p.rssiStrong;
+    if (shadows[k].p.windowMs > retain)  retain = shadows[k].p.windowMs;
+  }
+  hitAdmitRssi = admit;
+  hitRetainMs  = retain;
+}
+
+// Sólo contadores: el estado del detector (s.present) se conserva. Si difiere
+// de producción, el flanco pendiente se emparejará cuando el shadow lo haga.
+void resetShadowStats(Shadow& s, uint32_t t) {
+  s.onMatched  = !(present && !s.present);
+  s.offMatched = !(!present && s.present);
+  s.onFresh = s.offFresh = false;
+  s.lastOnTs = s.lastOffTs = t;
+  s.onLatSumMs = s.offLatSumMs = 0;
+  s.onLatN = s.offLatN = 0;
+  s.missedOn = s.missedOff = 0;
+  s.flaps = s.prodFlaps = 0;
+  s.disagreeMs = s.evalMs = 0;
+  s.weakLostBase = weakHitsLost;
+}
+
+void resetAllShadows(uint32_t t) {
+  for (uint8_t k = 0; k < MAX_SHADOWS; k++)
+    if (shadows[k].active) resetShadowStats(shadows[k], t);
+}
+
+// Llamar en cada cambio de estado de producción (present ya actualizado).
+// Un shadow que ya está en el nuevo estado sólo cuenta como adelantado si su
+// flanco es posterior al flanco opuesto anterior de producción. Si se mantuvo
+// en su estado durante todo el episodio contrario de producción (p.ej. un
+// off_gap más largo lo mantuvo ON durante un OFF→ON) sólo se cuenta el flanco
+// opuesto que no siguió, y el actual se da por coincidente.
+void shadowsOnProdEdge(uint32_t t) {
+  for (uint8_t k = 0; k < MAX_SHADOWS; k++) {
+    Shadow& s = shadows[k];
+    if (!s.active) continue;
+    s.prodFlaps++;
+    if (present) {
+      const bool heldOn = s.present && !s.offMatched;  // siguió ON todo el hueco de producción
+      if (!s.offMatched) s.missedOff++;  // el OFF anterior de producción nunca se siguió
+      s.offMatched = true;
+      s.offFresh = false;
+      s.onMatched = s.present;
+      if (s.present && !heldOn) {
+        if (s.onFresh) { s.onLatSumMs += (int32_t)(s.lastOnTs - t); s.onLatN++; }
+        else           s.missedOn++;
+      }
+    } else {
+      const bool heldOff = !s.present && !s.onMatched;  // siguió OFF todo el ON de producción
+      if (!s.onMatched) s.missedOn++;
+      s.onMatched = true;
+      s.onFresh = false;
+      s.offMatched = !s.present;
+      if (!s.present && !heldOff) {
+        if (s.offFresh) { s.offLatSumMs += (int32_t)(s.lastOffTs - t); s.offLatN++; }
+        else            s.missedOff++;
+      }
+    }
+  }
+}
+
+// Misma lógica que loop() para cada shadow, con una sola pasada sobre hits[]
+// (ya podado por countStrongInWindow con la retención común).
+// prodPrev: estado de producción antes de este tick (para el intervalo dt)
+void evalShadows(uint32_t t, bool prodPrev) {
+  static uint32_t lastT = 0;
+  const uint32_t dt = lastT ? (t - lastT) : 0;
+  lastT = t;
+
+  uint8_t  cnt[MAX_SHADOWS] = {0};
+  bool     vr[MAX_SHADOWS] = {false};
+  int      best[MAX_SHADOWS];
+  uint32_t tsBest[MAX_SHADOWS] = {0};
+  uint32_t cutW[MAX_SHADOWS], cutV[MAX_SHADOWS];
+  uint8_t  n = 0, idx[MAX_SHADOWS];
+
+  for (uint8_t k = 0; k < MAX_SHADOWS; k++) {
+    if (!shadows[k].active) continue;
+    cutW[n] = t - shadows[k].p.windowMs;
+    cutV[n] = t - shadows[k].p.vstrongAgeMs;
+    best[n] = -200;
+    idx[n++] = k;
+  }
+  if (n == 0) return;
+
+  for (uint8_t i = 0; i < hitCount; i++) {
+    const Hit h = hits[i];
+    for (uint8_t j = 0; j < n; j++) {
+      const DetParams& p = shadows[idx[j]].p;
+      if (h.rssi < p.rssiStrong || h.ts < cutW[j]) continue;
+      cnt[j]++;
+      if (h.rssi > best[j]) { best[j] = h.rssi; tsBest[j] = h.ts; }
+      if (h.rssi >= p.rssiVeryStrong && h.ts >= cutV[j]) vr[j] = true;
+    }
+  }
+
+  for (uint8_t j = 0; j < n; j++) {
+    Shadow& s = shadows[idx[j]];
+    bool wantOn = (cnt[j] >= s.p.hitsReq && (s.p.vstrongAgeMs == 0 || vr[j]));
+    if (s.present && tsBest[j] != 0 && (int32_t)(t - tsBest[j]) <= (int32_t)s.p.offGapMs) wantOn = true;
+
+    s.evalMs += dt;
+    if (s.present != prodPrev) s.disagreeMs += dt;
+
+    if (wantOn == s.present) continue;
+    s.present = wantOn;
+    s.flaps++;
+    if (s.present) {
+      s.lastOnTs = t;
+      s.onFresh = true;
+      if (present && !s.onMatched) { s.onLatSumMs += (int32_t)(t - prodOnTs); s.onLatN++; s.onMatched = true; }
+    } else {
+      s.lastOffTs = t;
+      s.offFresh = true;
+      if (!present && !s.offMatched) { s.offLatSumMs += (int32_t)(t - prodOffTs); s.offLatN++; s.offMatched = true; }
+    }
+  }
+}
 
 // ============== BLE: iniciar SOLO fuera de portal ===========
 bool bleStarted = false;
@@ -299,8 +486,8 @@ class AdvCB : public NimBLEScanCallbacks {
     if (md.size() < 2) return;
     if ((uint8_t)md[0] != 0x4C || (uint8_t)md[1] != 0x00) return; // Apple 0x004C
     const int rssi = dev->getRSSI();
+    if (rssi >= hitAdmitRssi) addHit(rssi);
     if (rssi >= RSSI_STRONG) {
-      addHit(rssi);
       lastStrongRSSI_forAttr = rssi;
 #if VERBOSO
       Serial.printf("[APPLE strong] RSSI=%d dBm addr=%s\n",
@@ -354,6 +541,50 @@ void saveParamsToNVS() {
   prefs.end();
 }
 
+// Shadows: "rssi_strong,rssi_verystrong,hits_req,strong_window_ms,vstrong_age_ms,off_gap_ms"
+bool parseShadowParams(const String& csv, DetParams& out) {
+  long rs, rvs, hr, win, age, gap; char extra;
+  if (sscanf(csv.c_str(), "%ld,%ld,%ld,%ld,%ld,%ld%c", &rs, &rvs, &hr, &win, &age, &gap, &extra) != 6) return false;
+  if (rs  < -95 || rs  > -40) return false;
+  if (rvs < -95 || rvs > -40) return false;
+  if (hr  < 1   || hr  > 6)   return false;
+  if (win < 1000 || win > 60000) return false;
+  if (age != 0 && (age < 500 || age > 60000)) return false;
+  if (gap < 1000 || gap > 180000) return false;
+  out = { (int)rs, (int)rvs, (uint8_t)hr, (uint32_t)win, (uint32_t)age, (uint32_t)gap };
+  return true;
+}
+
+bool sameShadowParams(const DetParams& a, const DetParams& b) {
+  return a.rssiStrong == b.rssiStrong && a.rssiVeryStrong == b.rssiVeryStrong
+      && a.hitsReq == b.hitsReq && a.windowMs == b.windowMs
+      && a.vstrongAgeMs == b.vstrongAgeMs && a.offGapMs == b.offGapMs;
+}
+
+String shadowParamsToCsv(const DetParams& p) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%d,%d,%u,%lu,%lu,%lu",
+           p.rssiStrong, p.rssiVeryStrong, p.hitsReq,
+           (unsigned long)p.windowMs, (unsigned long)p.vstrongAgeMs, (unsigned long)p.offGapMs);
+  return String(buf);
+}
+
+void loadShadowsFromNVS() {
+  if (!prefs.begin("shadow", true)) return;
+  for (uint8_t k = 0; k < MAX_SHADOWS; k++) {
+    String csv = prefs.getString((String("s") + k).c_str(), "");
+    shadows[k].active = !csv.isEmpty() && parseShadowParams(csv, shadows[k].p);
+  }
+  prefs.end();
+}
+void saveShadowToNVS(uint8_t k) {
+  if (!prefs.begin("shadow", false)) return;
+  const String key = String("s") + k;
+  if (shadows[k].active) prefs.putString(key.c_str(), shadowParamsToCsv(shadows[k].p));
+  else                   prefs.remove(key.c_str());
+  prefs.end();
+}
+
 // ================== Wi-Fi / MQTT infra ==================
 WiFiClient wifiClient;
 PubSubClient mqtt(wifiClient);
@@ -461,12 +692,76 @@ void publishParamStates() {
   mqttPublish(st_offgap,         String(OFF_GAP_MS), true);
 }
 
+// Retenido sólo para shadows activos; al desactivar se borra con payload vacío
+void publishShadowConfig(uint8_t k) {
+  mqttPublish(shadowBase + "/" + k + "/config",
+              shadows[k].active ? shadowParamsToCsv(shadows[k].p) : String(""), true);
+}
+
+void publishShadowStats() {
+  for (uint8_t k = 0; k < MAX_SHADOWS; k++) {
+    const Shadow& s = shadows[k];
+    if (!s.active) continue;
+    char buf[400];
+    snprintf(buf, sizeof(buf),
+      "{"
+        "\"onLatAvgMs\":%ld,\"onLatN\":%lu,\"offLatAvgMs\":%ld,\"offLatN\":%lu,"
+        "\"missedOn\":%lu,\"missedOff\":%lu,"
+        "\"flaps\":%lu,\"prodFlaps\":%lu,"
+        "\"disagreeMs\":%lu,\"disagreePct\":%.1f,\"evalMs\":%lu,"
+        "\"weakHitsLost\":%lu"
+      "}",
+      (long)(s.onLatN  ? s.onLatSumMs  / (int64_t)s.onLatN  : 0), (unsigned long)s.onLatN,
+      (long)(s.offLatN ? s.offLatSumMs / (int64_t)s.offLatN : 0), (unsigned long)s.offLatN,
+      (unsigned long)s.missedOn, (unsigned long)s.missedOff,
+      (unsigned long)s.flaps, (unsigned long)s.prodFlaps,
+      (unsigned long)s.disagreeMs, s.evalMs ? (100.0 * s.disagreeMs / s.evalMs) : 0.0,
+      (unsigned long)s.evalMs,
+      (unsigned long)(s.p.rssiStrong < RSSI_STRONG ? weakHitsLost - s.weakLostBase : 0)
+    );
+    mqttPublish(shadowBase + "/" + k + "/stats", buf, false);
+  }
+}
+
+// Payload CSV (ver parseShadowParams) activa/reemplaza el shadow; "off" lo desactiva
+void handleShadowCommand(const String& t, const String& pl) {
+  const String idxStr = t.substring(shadowBase.length() + 1, t.length() - 4);
+  if (idxStr.length() != 1 || !isDigit(idxStr[0]) || idxStr.toInt() >= MAX_SHADOWS) {
+    Serial.printf("Shadow inexistente: %s\n", t.c_str());
+    return;
+  }
+  const uint8_t k = (uint8_t)idxStr.toInt();
+  // Un /set retenido se reentrega en cada reconexión: si no cambia nada, no se
+  // resetean las estadísticas acumuladas
+  DetParams p;
+  if (pl.isEmpty() || pl.equalsIgnoreCase("off")) {
+    if (!shadows[k].active) return;
+    shadows[k].active = false;
+  } else if (parseShadowParams(pl, p)) {
+    if (shadows[k].active && sameShadowParams(shadows[k].p, p)) return;
+    if (!shadows[k].active) shadows[k].present = present;   // arranca alineado con producción
+    shadows[k].p = p;
+    shadows[k].active = true;
+    resetShadowStats(shadows[k], nowMs());
+  } else {
+    Serial.printf("Comando shadow invalido: %s = %s\n", t.c_str(), pl.c_str());
+    return;
+  }
+  recomputeHitEnvelope();
+  saveShadowToNVS(k);
+  publishShadowConfig(k);
+  Serial.printf("Shadow %u: %s (persistido)\n", k,
+                shadows[k].active ? shadowParamsToCsv(shadows[k].p).c_str() : "off");
+}
+
 void mqttCallback(char* topic, byte* payload, unsigned int len) {
   String t(topic);
   String pl; pl.reserve(len);
   for (unsigned int i=0;i<len;i++) pl += (char)payload[i];
   pl.trim();
 
+  if (t.startsWith(shadowBase + "/") && t.endsWith("/set")) { handleShadowCommand(t, pl); return; }
+
   auto toInt = [&](const String& s, long& out)->bool {
     char* endp=nullptr; long v = strtol(s.c_str(), &endp, 10);
     if (endp && *endp=='\0') { out=v; return true; }
@@ -477,25 +772,27 @@ void mqttCallback(char* topic, byte* payload, unsigned int len) {
   long v;
 
   if (t == cmd_rssiStrong && toInt(pl, v)) {
-    if (v >= -95 && v <= -40) { RSSI_STRONG = (int)v; changed=true; mqttPublish(st_rssiStrong, String(RSSI_STRONG), true); }
+    if (v >= -95 && v <= -40 && v != RSSI_STRONG) { RSSI_STRONG = (int)v; changed=true; mqttPublish(st_rssiStrong, String(RSSI_STRONG), true); }
   } else if (t == cmd_rssiVeryStrong && toInt(pl, v)) {
-    if (v >= -95 && v <= -40) { RSSI_VERY_STRONG = (int)v; changed=true; mqttPublish(st_rssiVeryStrong, String(RSSI_VERY_STRONG), true); }
+    if (v >= -95 && v <= -40 && v != RSSI_VERY_STRONG) { RSSI_VERY_STRONG = (int)v; changed=true; mqttPublish(st_rssiVeryStrong, String(RSSI_VERY_STRONG), true); }
   } else if (t == cmd_hitsReq && toInt(pl, v)) {
-    if (v >= 1 && v <= 6) { STRONG_HITS_REQ = (uint8_t)v; changed=true; mqttPublish(st_hitsReq, String(STRONG_HITS_REQ), true); }
+    if (v >= 1 && v <= 6 && v != STRONG_HITS_REQ) { STRONG_HITS_REQ = (uint8_t)v; changed=true; mqttPublish(st_hitsReq, String(STRONG_HITS_REQ), true); }
   } else if (t == cmd_window && toInt(pl, v)) {
-    if (v >= 1000 && v <= 60000) { STRONG_WINDOW_MS = (uint32_t)v; changed=true; mqttPublish(st_window, String(STRONG_WINDOW_MS), true); }
+    if (v >= 1000 && v <= 60000 && v != (long)STRONG_WINDOW_MS) { STRONG_WINDOW_MS = (uint32_t)v; changed=true; mqttPublish(st_window, String(STRONG_WINDOW_MS), true); }
   } else if (t == cmd_vstrongAge && toInt(pl, v)) {
-    if (v >= 500 && v <= 60000) { VERY_STRONG_MAX_AGE_MS = (uint32_t)v; changed=true; mqttPublish(st_vstrongAge, String(VERY_STRONG_MAX_AGE_MS), true); }
+    if (v >= 500 && v <= 60000 && v != (long)VERY_STRONG_MAX_AGE_MS) { VERY_STRONG_MAX_AGE_MS = (uint32_t)v; changed=true; mqttPublish(st_vstrongAge, String(VERY_STRONG_MAX_AGE_MS), true); }
   } else if (t == cmd_offgap && toInt(pl, v)) {
-    if (v >= 1000 && v <= 180000) { OFF_GAP_MS = (uint32_t)v; changed=true; mqttPublish(st_offgap, String(OFF_GAP_MS), true); }
+    if (v >= 1000 && v <= 180000 && v != (long)OFF_GAP_MS) { OFF_GAP_MS = (uint32_t)v; changed=true; mqttPublish(st_offgap, String(OFF_GAP_MS), true); }
   }
 
   if (changed) {
     saveParamsToNVS();
+    recomputeHitEnvelope();
+    resetAllShadows(nowMs());          // nueva referencia de producción
     publishAttributes(countStrongInWindow(), haveVeryStrongRecent(), ageSinceLastStrong());
     Serial.printf("Parametro actualizado via MQTT: %s = %ld (persistido)\n", t.c_str(), v);
   } else {
-    Serial.printf("Comando MQTT ignorado o fuera de rango: %s = %s\n", t.c_str(), pl.c_str());
+    Serial.printf("Comando MQTT ignorado, sin cambios o fuera de rango: %s = %s\n", t.c_str(), pl.c_str());
   }
 }
 
@@ -520,6 +817,9 @@ void ensureMQTT() {
     mqtt.subscribe(cmd_window.c_str());
     mqtt.subscribe(cmd_vstrongAge.c_str());
     mqtt.subscribe(cmd_offgap.c_str());
+    mqtt.subscribe(cmd_shadow.c_str());
+    for (uint8_t k = 0; k < MAX_SHADOWS; k++)
+      if (shadows[k].active) publishShadowConfig(k);
   } else {
     Serial.printf("MQTT fallo (%d). Reintentaremos.\n", mqtt.state());
   }
@@ -532,6 +832,7 @@ void factoryResetAndReboot() {
   prefs.begin("wifi", false); prefs.clear(); prefs.end();
   prefs.begin("cfg",  false); prefs.clear(); prefs.end();
   prefs.begin("mqtt", false); prefs.clear(); prefs.end();
+  prefs.begin("shadow", false); prefs.clear(); prefs.end();
   WiFi.disconnect(true, true);
   delay(200);
   ESP.restart();
@@ -554,6 +855,8 @@ void setup() {
   // Cargar parámetros y config MQTT persistidos
   loadParamsFromNVS();
   loadMqttFromNVS();
+  loadShadowsFromNVS();
+  recomputeHitEnvelope();
 
   // Selección de modo
   if (!haveSavedWiFi()) {
@@ -615,9 +918,11 @@ void loop() {
       publishState(false);
       publishAttributes(0, false, 0xFFFFFFFFUL);
     }
+    resetAllShadows(t);
   }
 
   // Lógica de presencia
+  const bool prevPresent = present;
   const uint8_t strongCnt = countStrongInWindow();
   const bool veryRecent   = haveVeryStrongRecent();
   bool wantOn = false;
@@ -630,6 +935,8 @@ void loop() {
 
   if (wantOn != present) {
     present = wantOn;
+    if (present) prodOnTs = t; else prodOffTs = t;
+    shadowsOnProdEdge(t);
     Serial.printf(">>> Estado: %s (strongInWin=%u, veryRecent=%s, gapStrong=%lums, lastRSSI=%d)\n",
                   present ? "ON" : "OFF",
                   strongCnt, veryRecent ? "YES":"NO",
@@ -641,11 +948,15 @@ void loop() {
     }
   }
 
+  // Shadows sobre el mismo buffer (tras decidir producción)
+  evalShadows(t, prevPresent);
+
   // Heartbeat / atributos periódicos
   if (t - lastStatus >= STATUS_EVERY_MS) {
     lastStatus = t;
     if (mqtt.connected()) {
       publishAttributes(countStrongInWindow(), haveVeryStrongRecent(), ageSinceLastStrong());
+      publishShadowStats();
     }
   }
 }